@@ -16,14 +16,25 @@ BoardData getInitialBoard() {
         board.piece[i] = init_piece[i];
     }
     board.whiteToMove = true;
+    board.castle = 15; // Both sides can still castle on both sides
+    board.ep = -1; // No en passant square
+    board.fifty = 0;
+    board.pos_hash = 0;
+    board.ply = 0;
+    board.hist_ply = 0;
     return board;
 }
 
 BoardData applyMove(BoardData board, Move m) {
     int fromIdx = m.from;
     int toIdx = m.to;
+    board.color[toIdx] = board.color[fromIdx];
     board.piece[toIdx] = board.piece[fromIdx];
+    board.color[fromIdx] = EMPTY;
     board.piece[fromIdx] = EMPTY;
+    board.ep = -1;
+    ++board.ply;
+    ++board.hist_ply;
     // No promotion, castling or en passant logic implemented here.
     // Change the side to move after applying the move.
     board.whiteToMove = !board.whiteToMove;
@@ -77,9 +88,10 @@ Zobrist::Zobrist() {
     whiteToMoveHash = rng();
 }
 
-uint64_t Zobrist::computeHash(const BoardData& board) {
+uint64_t Zobrist::computeHash(const BoardData& board) const {
     uint64_t h = 0;
     for (int sq = 0; sq < 64; ++sq) {
+        if (board.color[sq] == EMPTY) continue; // Only occupied squares have a piece hash
         int idx = board.color[sq];
         int idy = board.piece[sq];
         h ^= pieceHash[idx][idy][sq];
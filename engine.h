@@ -217,13 +217,12 @@ struct Zobrist {
     uint64_t whiteToMoveHash;
 
     Zobrist();
-    uint64_t computeHash(const BoardData& board);
+    uint64_t computeHash(const BoardData& board) const;
 };
 
 // Function Prototypes
 
 BoardData getInitialBoard();
 void parsePosition(const std::string& input, BoardData& board);
-Move findBestMoveParallel(BoardData board, int depth, int timeLimitMs);
 std::string moveToUci(const Move& m);
 BoardData applyMove(BoardData board, Move m);
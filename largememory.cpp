@@ -0,0 +1,218 @@
+// largememory.cpp
+
+// This file implements the LargeMemory class, defined in largememory.h.
+// On Linux the memory is mapped with mmap, trying reserved 1 GB and 2 MB huge pages first (MAP_HUGETLB),
+// then normal pages aligned to 2 MB with madvise(MADV_HUGEPAGE) to get transparent huge pages.
+// On other systems the memory is allocated with the aligned operator new.
+// Linux places a page on the NUMA node of the thread that first touches it, so clearing the memory
+// from threads pinned to CPUs spread over the allowed set spreads the table over all nodes instead of the allocating one.
+
+#include "largememory.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static const size_t MB = 1024 * 1024;
+static const size_t GB = 1024 * MB;
+
+LargeMemory::~LargeMemory() {
+    release();
+}
+
+bool LargeMemory::allocate(size_t size) {
+    release();
+    if (size == 0) return false;
+
+#ifdef __linux__
+    // Try reserved huge pages first, the largest page size that is not larger than the table.
+    // These fail unless the administrator has reserved pages (vm.nr_hugepages or hugepagesz=1G).
+    // The page size is encoded as its log2 in the bits at MAP_HUGE_SHIFT. The MAP_HUGE_1GB and MAP_HUGE_2MB
+    // names for these are only in <linux/mman.h>, so build the flags from MAP_HUGE_SHIFT, which glibc defines.
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    const int hugeFlags[2] = { 30 << MAP_HUGE_SHIFT, 21 << MAP_HUGE_SHIFT };
+    const size_t hugeSizes[2] = { GB, 2 * MB };
+    for (int i = 0; i < 2; ++i) {
+        if (size < hugeSizes[i]) continue;
+        size_t mapSize = (size + hugeSizes[i] - 1) / hugeSizes[i] * hugeSizes[i];
+        void* p = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | hugeFlags[i], -1, 0);
+        if (p != MAP_FAILED) {
+            ptr = p;
+            bytes = size;
+            mappedBytes = mapSize;
+            pageSize = hugeSizes[i];
+            clear();
+            return true;
+        }
+    }
+#endif
+
+    // Fall back to normal pages, aligned to 2 MB so that the kernel can back them with transparent huge pages.
+    // Map one alignment unit more than the rounded size, so an aligned block of the rounded size always fits.
+    const size_t alignment = 2 * MB;
+    size_t alignedSize = (size + alignment - 1) / alignment * alignment;
+    size_t mapSize = alignedSize + alignment;
+    void* p = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return false;
+    // Unmap the unaligned head and the tail of the mapping.
+    char* start = static_cast<char*>(p);
+    char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(start) + alignment - 1) & ~(alignment - 1));
+    char* end = aligned + alignedSize;
+    if (aligned > start) munmap(start, aligned - start);
+    if (start + mapSize > end) munmap(end, start + mapSize - end);
+    ptr = aligned;
+    bytes = size;
+    mappedBytes = alignedSize;
+    pageSize = 4096;
+#ifdef MADV_HUGEPAGE
+    if (madvise(ptr, mappedBytes, MADV_HUGEPAGE) == 0) {
+        pageSize = alignment;
+        transparent = true;
+    }
+#endif
+#else
+    ptr = ::operator new(size, std::align_val_t(2 * MB), std::nothrow);
+    if (!ptr) return false;
+    bytes = size;
+    mappedBytes = size;
+    pageSize = 0;
+#endif
+
+    clear();
+    return true;
+}
+
+void LargeMemory::release() {
+    if (!ptr) return;
+#ifdef __linux__
+    munmap(ptr, mappedBytes);
+#else
+    ::operator delete(ptr, std::align_val_t(2 * MB));
+#endif
+    ptr = nullptr;
+    bytes = 0;
+    mappedBytes = 0;
+    pageSize = 0;
+    transparent = false;
+    clearThreads = 0;
+    pinnedThreads = 0;
+}
+
+// Returns the CPUs the process may run on, or an empty vector if they are not known.
+static std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+#endif
+    return cpus;
+}
+
+void LargeMemory::swap(LargeMemory& other) {
+    std::swap(ptr, other.ptr);
+    std::swap(bytes, other.bytes);
+    std::swap(mappedBytes, other.mappedBytes);
+    std::swap(pageSize, other.pageSize);
+    std::swap(transparent, other.transparent);
+    std::swap(clearThreads, other.clearThreads);
+    std::swap(pinnedThreads, other.pinnedThreads);
+}
+
+void LargeMemory::clear() {
+    if (!ptr) return;
+    std::vector<int> cpus = allowedCpus();
+    size_t n = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+    if (n == 0) n = 1;
+    // Split the memory in page aligned slices, one per thread, so no page is touched by two threads.
+    size_t unit = pageSize > 0 ? pageSize : 4096;
+    size_t units = (bytes + unit - 1) / unit;
+    if (n > units) n = units;
+    size_t perThread = (units + n - 1) / n * unit;
+
+    std::atomic<size_t> pinned(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n; ++i) {
+        // With fewer threads than allowed CPUs (e.g. a few 1 GB pages), spread the threads over the whole
+        // allowed set rather than its first CPUs, which are usually all on the same NUMA node.
+        int cpu = cpus.empty() ? -1 : cpus[i * cpus.size() / n];
+        threads.emplace_back([this, i, cpu, perThread, &pinned]() {
+#ifdef __linux__
+            // Pin the thread to its CPU, so that its pages are placed on that CPU's NUMA node.
+            if (cpu >= 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+                    ++pinned;
+            }
+#endif
+            size_t begin = i * perThread;
+            if (begin >= bytes) return;
+            size_t length = std::min(perThread, bytes - begin);
+            std::memset(static_cast<char*>(ptr) + begin, 0, length);
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    clearThreads = n;
+    pinnedThreads = pinned;
+}
+
+// Returns the number of bytes in [start, start + length) backed by transparent huge pages,
+// read from the AnonHugePages field of the mappings in /proc/self/smaps, or 0 if not known.
+static size_t transparentHugeBytes(const void* start, size_t length) {
+    size_t total = 0;
+#ifdef __linux__
+    std::ifstream smaps("/proc/self/smaps");
+    uintptr_t begin = reinterpret_cast<uintptr_t>(start);
+    uintptr_t end = begin + length;
+    bool inside = false;
+    std::string line;
+    while (std::getline(smaps, line)) {
+        unsigned long from, to;
+        // Mapping header lines start with the address range, e.g. "7f0000000000-7f0040000000 rw-p ...".
+        if (std::sscanf(line.c_str(), "%lx-%lx ", &from, &to) == 2 && line.find(':') > line.find(' ')) {
+            inside = from < end && to > begin;
+        } else if (inside && line.compare(0, 14, "AnonHugePages:") == 0) {
+            total += std::strtoull(line.c_str() + 14, nullptr, 10) * 1024;
+        }
+    }
+#endif
+    return std::min(total, length);
+}
+
+std::string LargeMemory::pageSizeName() const {
+    if (pageSize >= GB) return std::to_string(pageSize / GB) + " GB pages";
+    if (transparent) {
+        // Transparent huge pages are only a request, so report how much of the memory the kernel backed with them.
+        size_t huge = transparentHugeBytes(ptr, mappedBytes);
+        if (huge == 0) return "4 KB pages (transparent huge pages not granted)";
+        return "2 MB transparent pages for " + std::to_string(huge / MB) + " of " + std::to_string(mappedBytes / MB) + " MB";
+    }
+    if (pageSize >= MB) return std::to_string(pageSize / MB) + " MB pages";
+    if (pageSize > 0) return std::to_string(pageSize / 1024) + " KB pages";
+    return "default pages";
+}
+
+std::string LargeMemory::placementName() const {
+    if (clearThreads == 0) return "not cleared";
+    if (pinnedThreads == clearThreads)
+        return "first touch from " + std::to_string(clearThreads) + (clearThreads == 1 ? " pinned CPU" : " pinned CPUs");
+    return "first touch from " + std::to_string(clearThreads) + " threads, " + std::to_string(pinnedThreads) + " pinned";
+}
@@ -0,0 +1,51 @@
+// largememory.h
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// LargeMemory class to own a large block of memory, such as the transposition table.
+// It tries to get the memory on 1 GB or 2 MB huge pages, which avoids most of the TLB misses
+// of a large table, and falls back to normal pages when huge pages are not available.
+// The memory is prefaulted and cleared in parallel by threads pinned to CPUs spread over the allowed set,
+// so that the pages are placed on every NUMA node rather than on a single one.
+class LargeMemory {
+public:
+    LargeMemory() = default;
+    ~LargeMemory();
+    LargeMemory(const LargeMemory&) = delete;
+    LargeMemory& operator=(const LargeMemory&) = delete;
+
+    // Allocate size bytes, freeing any previous allocation, and clear them.
+    // Returns false if the memory could not be allocated.
+    bool allocate(size_t size);
+    // Free the memory.
+    void release();
+    // Exchange the memory owned by this object and by other.
+    void swap(LargeMemory& other);
+    // Clear the memory to zero in parallel.
+    void clear();
+
+    void* data() const { return ptr; }
+    size_t size() const { return bytes; }
+    // Returns a description of the page size obtained, e.g. "2 MB pages".
+    std::string pageSizeName() const;
+    // Returns a description of how the pages were placed by the last clear, e.g. "first touch from 8 pinned CPUs".
+    std::string placementName() const;
+
+private:
+    // Start of the usable memory, aligned to the page size.
+    void* ptr = nullptr;
+    // Size of the usable memory in bytes.
+    size_t bytes = 0;
+    // Size of the memory mapping, which may be larger than bytes because of alignment.
+    size_t mappedBytes = 0;
+    // Page size obtained in bytes, 0 if unknown.
+    size_t pageSize = 0;
+    // True if transparent huge pages were requested rather than reserved huge pages.
+    bool transparent = false;
+    // Number of threads used by the last clear, and how many of them could be pinned to their CPU.
+    size_t clearThreads = 0;
+    size_t pinnedThreads = 0;
+};
@@ -1,9 +1,26 @@
 // main.cpp
 
 #include <iostream>
+#include <string>
+#include <cstdlib>
 #include "uci.h"
 
-int main() {
-    runUciLoop();
+int main(int argc, char* argv[]) {
+    // With --server, many UCI sessions are multiplexed over stdin and stdout.
+    // With --hash MB, the server sessions share a transposition table of that size.
+    bool server = false;
+    int hashMb = DEFAULT_HASH_MB;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--server")
+            server = true;
+        else if (arg == "--hash" && i + 1 < argc)
+            hashMb = std::atoi(argv[++i]);
+    }
+
+    if (server)
+        runServerLoop(hashMb);
+    else
+        runUciLoop();
     return 0;
 }
@@ -2,11 +2,53 @@
 
 #include "search.h"
 #include "threadpool.h"
+#include "trace.h"
 
 #include <limits>
 
 const int INF = std::numeric_limits<int>::max();
 
+// Time slice in milliseconds of a root move task before it gives its worker to the tasks of another
+// queue (another UCI session), if any are waiting. The slice doubles each time the task is enqueued again,
+// up to TASK_SLICE_MAX_MS, which bounds how long the other sessions wait for a worker.
+const int TASK_SLICE_MS = 5;
+const int TASK_SLICE_MAX_MS = 40;
+// Number of nodes searched between two checks of the time slice.
+const int TASK_SLICE_NODES = 256;
+
+// The TaskSlice structure holds the time slice of the root move task running on this thread.
+struct TaskSlice {
+    ThreadPool* pool;
+    int queueId;
+    std::chrono::milliseconds length;
+    std::chrono::steady_clock::time_point end;
+    int nodes; // Nodes searched since the last check of the time slice.
+    bool preempted; // Set when the task must return and be enqueued again.
+};
+
+static thread_local TaskSlice* currentSlice = nullptr;
+
+// Returns true if the search results are not reliable because the search was stopped,
+// the deadline was reached or the task running on this thread was preempted.
+static bool interrupted(const SearchControl& control) {
+    return control.timeUp() || (currentSlice && currentSlice->preempted);
+}
+
+// Returns true if the search must return now. Like interrupted, but also checks whether the
+// time slice of the task is over while the tasks of another queue are waiting for a worker.
+static bool mustReturn(const SearchControl& control) {
+    if (interrupted(control)) return true;
+    TaskSlice* slice = currentSlice;
+    if (!slice || ++slice->nodes < TASK_SLICE_NODES) return false;
+    slice->nodes = 0;
+    auto now = std::chrono::steady_clock::now();
+    if (now < slice->end) return false;
+    // Nobody is waiting: keep the worker for another slice before checking again.
+    slice->preempted = slice->pool->othersWaiting(slice->queueId);
+    slice->end = now + slice->length;
+    return slice->preempted;
+}
+
 std::vector<Move> generateMoves(const BoardData& board) {
     std::vector<Move> moves;
     int i, j, n;
@@ -74,95 +116,192 @@ std::vector<Move> generateMoves(const BoardData& board) {
     return moves;
 }
 
-Move findBestMoveParallel(BoardData board, int depth, int timeLimitMs) {
-    auto moves = generateMoves(board);
-    if (moves.empty()) return {0, 0, 0, 0}; // No moves available
-    if (moves.size() == 1) return moves[0]; // Only one move available return it
-    if (depth < 1) depth = 1; // Ensure depth is at least 1
+void SearchControl::setTimeLimit(int timeLimitMs) {
     if (timeLimitMs < 100) timeLimitMs = 100; // Ensure time limit is at least 100ms
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeLimitMs);
+    deadline = end.time_since_epoch().count();
+}
 
-    if (depth == 1) {
-        // If depth is 1, just return the best move based on evaluation
-        int bestScore = -INF;
-        Move bestMove = moves[0];
-        for (const auto& m : moves) {
-            BoardData nextBoard = applyMove(board, m);
-            int score = evaluate(nextBoard);
-            if (score > bestScore) {
-                bestScore = score;
-                bestMove = m;
-            }
-        }
-        return bestMove;
-    }
+bool SearchControl::timeUp() const {
+    if (stop.load()) return true;
+    // While pondering or analysing there is no deadline, only stop or ponderhit end the search.
+    // A search limited by depth only ends at that depth or on stop.
+    if (pondering.load() || infinite.load() || untimed.load()) return false;
+    return std::chrono::steady_clock::now().time_since_epoch().count() > deadline.load();
+}
 
-    // Create a thread pool with the number of threads equal to the number of available cores.
-    ThreadPool pool(std::thread::hardware_concurrency());
-    // Create vector to hold futures for the results of each task.
-    std::vector<std::future<int>> futures;
+// Search the replies to a root move and record the reply with the lowest score.
+// This reply is the move we expect the opponent to play, so it becomes the ponder move.
+static int searchReplies(const BoardData& board, int depth, SearchControl& control, Move& bestReply) {
+    if (mustReturn(control)) return 0;
+    TRACE(traceNode(board.ply));
 
-    // Create atomic flag to stop the search if time limit is reached.
-    std::atomic<bool> localStop(false);
-    // Set the deadline for the search based on the time limit.
-    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeLimitMs);
+    auto moves = generateMoves(board);
+    if (moves.empty()) return evaluate(board);
+    TRACE(traceMoves(board.ply, moves.size()));
 
-    // Enqueue tasks for each move and collect futures.
-    // This allows us to run the alphabeta search in parallel for each move.
-    for (const auto& m : moves) {
-        BoardData nextBoard = applyMove(board, m);
-        futures.emplace_back(pool.enqueue([=, &localStop]() {
-            return alphabetaTimed(nextBoard, depth - 1, -INF, INF, false, deadline, localStop);
-        }));
+    int minEval = INF;
+    int beta = INF;
+    for (auto& m : moves) {
+        BoardData newBoard = applyMove(board, m);
+        int eval = alphabetaTimed(newBoard, depth - 1, -INF, beta, true, control);
+        if (eval < minEval) {
+            minEval = eval;
+            bestReply = m;
+        }
+        beta = std::min(beta, eval);
     }
+    return minEval;
+}
+
+SearchResult findBestMoveParallel(BoardData board, int depth, SearchControl& control, ThreadPool& pool, int queueId) {
+    SearchResult result = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+    auto moves = generateMoves(board);
+    if (moves.empty()) return result; // No moves available
+    result.bestMove = moves[0];
+    if (moves.size() == 1) return result; // Only one move available return it
+    if (depth < 1) depth = 1; // Ensure depth is at least 1
+    board.ply = 0; // The root of the search tree
 
+    // Depth 1: just take the best move based on evaluation.
+    // This gives us a move to play even if the first full iteration does not complete in time.
     int bestScore = -INF;
-    Move bestMove = moves[0];
-    // Wait for each future to complete and determine the best move.
-    for (size_t i = 0; i < moves.size(); ++i) {
-        // If the time limit is reached, we stop processing further.
-        if (std::chrono::steady_clock::now() > deadline) {
-            localStop = true;
-            break;
-        }
-        // Get the result of the future.
-        // This will block until the task is complete.
-        // If the task was stopped due to time limit, it will return 0.
-        // Otherwise, it will return the evaluation score for the move.
-        int score = futures[i].get();
+    for (const auto& m : moves) {
+        BoardData nextBoard = applyMove(board, m);
+        int score = evaluate(nextBoard);
         if (score > bestScore) {
             bestScore = score;
-            bestMove = moves[i];
+            result.bestMove = m;
+        }
+    }
+
+    // Iterative deepening: search one ply deeper each iteration until the depth limit is reached
+    // or the search is stopped. A ponder search keeps deepening until ponderhit gives it a deadline,
+    // so the time spent on the opponent's clock is not lost when the expected move is played.
+    for (int d = 2; d <= depth && !control.timeUp(); ++d) {
+#ifdef MINDFIELD_TRACE
+        auto iterationStart = std::chrono::steady_clock::now();
+#endif
+        // Create vectors to hold the futures, scores, replies and time slices of each task.
+        // A future returns true if its task was preempted and must be enqueued again.
+        std::vector<std::future<bool>> futures(moves.size());
+        std::vector<int> scores(moves.size(), 0);
+        std::vector<Move> replies(moves.size(), {0, 0, 0, 0});
+        std::vector<std::chrono::milliseconds> slices(moves.size(), std::chrono::milliseconds(TASK_SLICE_MS));
+
+        // Enqueue the task searching the move at index i.
+        // A preempted task keeps the subtrees it completed in the transposition table,
+        // so most of its work is not repeated when it is enqueued again with a longer slice.
+        auto enqueueMove = [&](size_t i) {
+            BoardData nextBoard = applyMove(board, moves[i]);
+            int* score = &scores[i];
+            Move* reply = &replies[i];
+            std::chrono::milliseconds length = slices[i];
+            futures[i] = pool.enqueue([=, &control, &pool]() {
+                TRACE(traceSetIteration(d));
+                TaskSlice slice = {&pool, queueId, length, std::chrono::steady_clock::now() + length, 0, false};
+                currentSlice = &slice;
+                *score = searchReplies(nextBoard, d - 1, control, *reply);
+                currentSlice = nullptr;
+                return slice.preempted;
+            }, queueId);
+        };
+
+        // Record the root node of this iteration, which the tasks only search below.
+        TRACE(traceSetIteration(d));
+        TRACE(traceNode(board.ply));
+        TRACE(traceMoves(board.ply, moves.size()));
+
+        // Enqueue tasks for each move.
+        // This allows us to run the alphabeta search in parallel for each move.
+        for (size_t i = 0; i < moves.size(); ++i)
+            enqueueMove(i);
+
+        // Wait for each task to complete and determine the best move of this iteration.
+        // Tasks return immediately once the search is stopped or the deadline is reached.
+        int iterationScore = -INF;
+        SearchResult iterationResult = result;
+        for (size_t i = 0; i < moves.size(); ++i) {
+            while (futures[i].get()) {
+                slices[i] = std::min(slices[i] * 2, std::chrono::milliseconds(TASK_SLICE_MAX_MS));
+                enqueueMove(i);
+            }
+            int score = scores[i];
+            if (score > iterationScore) {
+                iterationScore = score;
+                iterationResult.bestMove = moves[i];
+                iterationResult.ponderMove = replies[i];
+            }
         }
+
+        bool completed = !control.timeUp();
+        TRACE(traceIteration(d, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - iterationStart).count(), completed));
+
+        // The scores of an interrupted iteration are not reliable, so keep the previous result.
+        if (!completed) break;
+        result = iterationResult;
     }
-    return bestMove;
+    return result;
 }
 
-int alphabetaTimed(BoardData board, int depth, int alpha, int beta, bool maximizing, std::chrono::steady_clock::time_point deadline, std::atomic<bool>& stop) {
-    if (stop.load() || std::chrono::steady_clock::now() > deadline) return 0;
+int alphabetaTimed(BoardData board, int depth, int alpha, int beta, bool maximizing, SearchControl& control) {
+    if (mustReturn(control)) return 0;
+    TRACE(traceNode(board.ply));
     if (depth == 0) return evaluate(board);
 
+    // Look the position up in the transposition table, which may decide the node or narrow the window.
+    uint64_t key = 0;
+    if (control.tt) {
+        key = control.tt->key(board, maximizing);
+        int score;
+        if (control.tt->probe(key, depth, alpha, beta, score)) {
+            TRACE(traceTTCutoff(board.ply));
+            return score;
+        }
+    }
+
     auto moves = generateMoves(board);
     if (moves.empty()) return evaluate(board);
+    TRACE(traceMoves(board.ply, moves.size()));
 
+    // Keep the window searched, to know whether the result is exact or only a bound.
+    int alphaSearched = alpha;
+    int betaSearched = beta;
+    int result;
     if (maximizing) {
         int maxEval = -INF;
-        for (auto& m : moves) {
-            BoardData newBoard = applyMove(board, m);
-            int eval = alphabetaTimed(newBoard, depth - 1, alpha, beta, false, deadline, stop);
+        for (size_t i = 0; i < moves.size(); ++i) {
+            BoardData newBoard = applyMove(board, moves[i]);
+            int eval = alphabetaTimed(newBoard, depth - 1, alpha, beta, false, control);
             maxEval = std::max(maxEval, eval);
             alpha = std::max(alpha, eval);
-            if (beta <= alpha) break;
+            if (beta <= alpha) {
+                TRACE(traceCutoff(board.ply, i));
+                break;
+            }
         }
-        return maxEval;
+        result = maxEval;
     } else {
         int minEval = INF;
-        for (auto& m : moves) {
-            BoardData newBoard = applyMove(board, m);
-            int eval = alphabetaTimed(newBoard, depth - 1, alpha, beta, true, deadline, stop);
+        for (size_t i = 0; i < moves.size(); ++i) {
+            BoardData newBoard = applyMove(board, moves[i]);
+            int eval = alphabetaTimed(newBoard, depth - 1, alpha, beta, true, control);
             minEval = std::min(minEval, eval);
             beta = std::min(beta, eval);
-            if (beta <= alpha) break;
+            if (beta <= alpha) {
+                TRACE(traceCutoff(board.ply, i));
+                break;
+            }
         }
-        return minEval;
+        result = minEval;
+    }
+
+    // The result of an interrupted search is not reliable, so it must not be stored.
+    if (control.tt && !interrupted(control)) {
+        TTBound bound = TT_EXACT;
+        if (result <= alphaSearched) bound = TT_UPPER_BOUND;
+        else if (result >= betaSearched) bound = TT_LOWER_BOUND;
+        control.tt->store(key, depth, result, bound);
     }
+    return result;
 }
@@ -4,14 +4,47 @@
 
 #include "engine.h"
 #include "threadpool.h"
+#include "tt.h"
 
 #include <chrono>
 #include <atomic>
 #include <vector>
 #include <future>
+#include <cstdint>
 
+// Maximum depth for the iterative deepening loop when no depth limit is given.
+const int MAX_SEARCH_DEPTH = 64;
+
+// The SearchControl structure is shared between the UCI thread and the search threads.
+// The UCI thread can stop the search at any time, or turn a ponder search into a timed search
+// on ponderhit, without the search being restarted.
+// While pondering or analysing (go infinite) the search has no deadline.
+// A search given only a depth limit (go depth) has no deadline either, but reports its result when done.
+struct SearchControl {
+    std::atomic<bool> stop{false}; // Set to abort the search as soon as possible.
+    std::atomic<bool> pondering{false}; // Set while searching on the opponent's time (go ponder).
+    std::atomic<bool> infinite{false}; // Set while searching until stop is received (go infinite).
+    std::atomic<bool> untimed{false}; // Set while searching to a depth limit only (go depth or go mate).
+    std::atomic<int64_t> deadline{0}; // The deadline in steady_clock ticks, only used when not pondering.
+    TranspositionTable* tt = nullptr; // The transposition table used by the search, if any.
+
+    // Set the deadline to timeLimitMs milliseconds from now.
+    void setTimeLimit(int timeLimitMs);
+    // Returns true if the search must return now.
+    bool timeUp() const;
+    // Returns true if the result must be held back until ponderhit or stop is received.
+    bool mustWait() const { return !stop.load() && (pondering.load() || infinite.load()); }
+};
+
+// The SearchResult structure holds the best move found and the expected reply to ponder on.
+// If no reply is known, ponderMove.from equals ponderMove.to.
+struct SearchResult {
+    Move bestMove;
+    Move ponderMove;
+};
 
 int evaluate(const BoardData& board);
 std::vector<Move> generateMoves(const BoardData& board);
-Move findBestMoveParallel(BoardData board, int depth, int timeLimitMs);
-int alphabetaTimed(BoardData board, int depth, int alpha, int beta, bool maximizing, std::chrono::steady_clock::time_point deadline, std::atomic<bool>& stop);
\ No newline at end of file
+// Search the root moves in parallel on the given thread pool, using the queue given by queueId.
+SearchResult findBestMoveParallel(BoardData board, int depth, SearchControl& control, ThreadPool& pool, int queueId = 0);
+int alphabetaTimed(BoardData board, int depth, int alpha, int beta, bool maximizing, SearchControl& control);
\ No newline at end of file
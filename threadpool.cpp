@@ -5,8 +5,17 @@
 // The worker threads are initialized by the constructor, who then puts them in an endless loop while they wait for jobs to be enqueued.
 // It enhances performance by lowering the overhead of thread generation and destruction through thread reuse.
 // It allows tasks to be executed asynchronously, enabling parallel processing of tasks.
+// Tasks are kept in one queue per id and the queues are served round robin, so that the pool
+// can be shared fairly between several independent users such as concurrent UCI sessions.
+// A queue keeps its turn until its tasks have used a time quantum, so a queue of many short tasks
+// gets as much worker time as a queue of long tasks, rather than one task per turn.
 
 #include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+
+// Worker time a queue may use before its turn passes to the next queue.
+static const std::chrono::steady_clock::duration turnQuantum = std::chrono::milliseconds(5);
 
 // Constructor to initialize the thread pool with a given number of threads.
 ThreadPool::ThreadPool(size_t n) : stop(false) {
@@ -15,20 +24,47 @@ ThreadPool::ThreadPool(size_t n) : stop(false) {
         workers.emplace_back([this] {
             while (true) {
                 std::function<void()> task;
+                int queueId;
                 // Lock the queue mutex to ensure thread-safe access to the task queue
                 // Unlock the queue before executing the task so that other threads can perform enqueue tasks
                 {
                     // Lock the queue so that data can be shared safely
                     std::unique_lock<std::mutex> lock(queue_mutex);
                     // Wait until there is a task to execute or the pool is stopped
-                    condition.wait(lock, [this] { return stop || !tasks.empty(); });
+                    condition.wait(lock, [this] { return stop || !ready.empty(); });
                     // If the pool is stopped and there are no tasks, exit the thread
-                    if (stop && tasks.empty()) return;
-                    // Get the next task from the queue
+                    if (stop && ready.empty()) return;
+                    // Get the next task from the queue whose turn it is
+                    queueId = ready.front();
+                    std::queue<std::function<void()>>& tasks = queues[queueId];
                     task = std::move(tasks.front());
                     tasks.pop();
+                    // If the queue has no more tasks it is removed and the turn passes to the next queue
+                    if (tasks.empty()) {
+                        ready.pop_front();
+                        queues.erase(queueId);
+                        turnUsed.erase(queueId);
+                    }
                 }
+                auto start = std::chrono::steady_clock::now();
                 task();
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                {
+                    // Once the queue has used its quantum it goes to the back of the line
+                    std::unique_lock<std::mutex> lock(queue_mutex);
+                    if (queues.count(queueId)) {
+                        std::chrono::steady_clock::duration& used = turnUsed[queueId];
+                        used += elapsed;
+                        if (used >= turnQuantum) {
+                            used = std::chrono::steady_clock::duration::zero();
+                            auto it = std::find(ready.begin(), ready.end(), queueId);
+                            if (it != ready.end()) {
+                                ready.erase(it);
+                                ready.push_back(queueId);
+                            }
+                        }
+                    }
+                }
             }
         });
 }
@@ -48,4 +84,12 @@ ThreadPool::~ThreadPool() {
         worker.join();
 }
 
+// Returns true if tasks of a queue other than queueId are waiting for a worker.
+bool ThreadPool::othersWaiting(int queueId) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    for (int id : ready)
+        if (id != queueId) return true;
+    return false;
+}
+
 // Template member function definitions should be in the header file, so removed from cpp.
@@ -2,17 +2,26 @@
 
 #pragma once
 
-#include "search.h"
 #include <vector>
 #include <thread>
 #include <queue>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
 #include <future>
+#include <chrono>
 
 // ThreadPool class to manage a pool of worker threads for parallel task execution.
 // It allows tasks to be enqueued and executed asynchronously.
+// Each task belongs to a queue, identified by an id (e.g. a UCI session), and the worker threads
+// take tasks from the non-empty queues in turn, each queue for a short quantum of worker time,
+// so that one busy queue cannot starve the others.
+// Long running tasks should check othersWaiting from time to time and return early, to give their worker
+// to the other queues, since a running task is never preempted.
 class ThreadPool {
 public:
     ThreadPool(size_t n);
@@ -21,7 +30,7 @@ public:
     template<class F>
     // Enqueue a task to be executed by the thread pool.
     // Returns a future that can be used to retrieve the result of the task.
-    auto enqueue(F&& f) -> std::future<decltype(f())> {
+    auto enqueue(F&& f, int queueId = 0) -> std::future<decltype(f())> {
         using return_type = decltype(f());
         auto task = std::make_shared<std::packaged_task<return_type()>>(std::forward<F>(f));
         std::future<return_type> res = task->get_future();
@@ -29,18 +38,29 @@ public:
             std::unique_lock<std::mutex> lock(queue_mutex);
             if (stop)
                 throw std::runtime_error("enqueue on stopped ThreadPool");
+            std::queue<std::function<void()>>& tasks = queues[queueId];
+            // A queue that was empty joins the end of the round robin order.
+            if (tasks.empty())
+                ready.push_back(queueId);
             tasks.emplace([task]() { (*task)(); });
         }
         condition.notify_one();
         return res;
     }
 
+    // Returns true if tasks of a queue other than queueId are waiting for a worker.
+    bool othersWaiting(int queueId);
+
 private:
     // Vector to store worker threads that will execute tasks.
     std::vector<std::thread> workers;
-    // Queue to hold tasks that are waiting to be executed.
+    // Queues to hold tasks that are waiting to be executed, by queue id.
     // Using a queue allows tasks to be processed in the order they are added.
-    std::queue<std::function<void()>> tasks;
+    std::unordered_map<int, std::queue<std::function<void()>>> queues;
+    // Ids of the non-empty queues, in the round robin order in which they are served.
+    std::deque<int> ready;
+    // Worker time used by each queue in its current turn.
+    std::unordered_map<int, std::chrono::steady_clock::duration> turnUsed;
     // Mutex to protect access to the task queue.
     // This ensures that only one thread can modify the queue at a time.
     std::mutex queue_mutex;
@@ -0,0 +1,243 @@
+// trace.cpp
+
+// This file implements the search tracing declared in trace.h.
+// Each thread gets a ThreadTrace on its first record, registered in a global list so that traceFlush can find it.
+// The owning thread updates its counters with relaxed atomic adds and traceFlush takes and resets them with an atomic
+// exchange, so no count is lost or carried over, even while other sessions keep searching during a flush.
+// Only the owning thread writes the event ring buffer and its head: it stores the event and then advances the head.
+// traceFlush keeps its own tail, the head at the previous flush, and reads the events between tail and head.
+
+#ifdef MINDFIELD_TRACE
+
+#include "trace.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> traceEnabled(false);
+
+// Types of the events kept in the ring buffers.
+enum TraceEventType : uint64_t {
+    TRACE_EVENT_CUTOFF = 1,
+    TRACE_EVENT_ITERATION = 2
+};
+
+// Per thread trace records.
+// The node, move and cutoff counts are kept by iteration depth and ply, so that each iteration can be reported on its own.
+struct ThreadTrace {
+    std::atomic<uint64_t> nodes[TRACE_MAX_DEPTH + 1][TRACE_MAX_PLY + 1];
+    std::atomic<uint64_t> moves[TRACE_MAX_DEPTH + 1][TRACE_MAX_PLY + 1];
+    std::atomic<uint64_t> cutoffs[TRACE_MAX_DEPTH + 1][TRACE_MAX_PLY + 1];
+    std::atomic<uint64_t> ttCutoffs[TRACE_MAX_DEPTH + 1][TRACE_MAX_PLY + 1];
+    std::atomic<uint64_t> cutoffIndex[TRACE_MAX_MOVE_INDEX + 1];
+    // Depth of the iteration the thread searches for, written only by the owning thread.
+    int depth;
+    // Events packed as type (bits 56-63), depth or ply (bits 48-55), move index (bits 32-47) and value (bits 0-31).
+    std::atomic<uint64_t> events[TRACE_RING_SIZE];
+    // Number of events written by the owning thread.
+    std::atomic<uint64_t> head;
+    // Value of head at the previous flush, written only by traceFlush.
+    uint64_t tail;
+
+    ThreadTrace();
+    ~ThreadTrace();
+};
+
+// Mutex to protect the list of thread traces and the trace file.
+static std::mutex traceMutex;
+static std::vector<ThreadTrace*> threadTraces;
+static std::string traceFile;
+static uint64_t traceSearches = 0;
+
+ThreadTrace::ThreadTrace() : depth(0), head(0), tail(0) {
+    for (int d = 0; d <= TRACE_MAX_DEPTH; ++d)
+        for (int i = 0; i <= TRACE_MAX_PLY; ++i)
+            nodes[d][i] = moves[d][i] = cutoffs[d][i] = ttCutoffs[d][i] = 0;
+    for (int i = 0; i <= TRACE_MAX_MOVE_INDEX; ++i)
+        cutoffIndex[i] = 0;
+    std::lock_guard<std::mutex> lock(traceMutex);
+    threadTraces.push_back(this);
+}
+
+ThreadTrace::~ThreadTrace() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    threadTraces.erase(std::find(threadTraces.begin(), threadTraces.end(), this));
+}
+
+// Returns the trace of the calling thread.
+static ThreadTrace& threadTrace() {
+    thread_local ThreadTrace trace;
+    return trace;
+}
+
+// Increment a counter of the calling thread, which traceFlush may reset concurrently.
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t amount = 1) {
+    counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+static inline int clampDepth(int depth) {
+    return std::max(0, std::min(depth, TRACE_MAX_DEPTH));
+}
+
+static inline int clampPly(int ply) {
+    return std::max(0, std::min(ply, TRACE_MAX_PLY));
+}
+
+static void pushEvent(uint64_t type, int depth, int index, uint32_t value) {
+    ThreadTrace& t = threadTrace();
+    uint64_t head = t.head.load(std::memory_order_relaxed);
+    uint64_t event = type << 56 | static_cast<uint64_t>(depth & 0xFF) << 48
+                   | static_cast<uint64_t>(index & 0xFFFF) << 32 | value;
+    t.events[head % TRACE_RING_SIZE].store(event, std::memory_order_relaxed);
+    t.head.store(head + 1, std::memory_order_release);
+}
+
+void traceSetFile(const std::string& path) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceFile = path;
+    traceEnabled = !path.empty();
+}
+
+void traceSetIteration(int depth) {
+    threadTrace().depth = clampDepth(depth);
+}
+
+void traceNode(int ply) {
+    ThreadTrace& t = threadTrace();
+    bump(t.nodes[t.depth][clampPly(ply)]);
+}
+
+void traceMoves(int ply, int moveCount) {
+    ThreadTrace& t = threadTrace();
+    bump(t.moves[t.depth][clampPly(ply)], moveCount);
+}
+
+void traceCutoff(int ply, int moveIndex) {
+    ThreadTrace& t = threadTrace();
+    bump(t.cutoffs[t.depth][clampPly(ply)]);
+    bump(t.cutoffIndex[std::min(moveIndex, TRACE_MAX_MOVE_INDEX)]);
+    pushEvent(TRACE_EVENT_CUTOFF, clampPly(ply), moveIndex, 0);
+}
+
+void traceTTCutoff(int ply) {
+    ThreadTrace& t = threadTrace();
+    bump(t.ttCutoffs[t.depth][clampPly(ply)]);
+}
+
+void traceIteration(int depth, long long elapsedUs, bool completed) {
+    pushEvent(TRACE_EVENT_ITERATION, depth, completed ? 1 : 0, static_cast<uint32_t>(std::min(elapsedUs, 0xFFFFFFFFLL)));
+}
+
+// Take the value of a counter and reset it. A counter read as zero is left alone, which saves
+// writing the many counters of unused depths and plies; an add racing with that read is reported next flush.
+static inline uint64_t takeCounter(std::atomic<uint64_t>& counter) {
+    if (counter.load(std::memory_order_relaxed) == 0) return 0;
+    return counter.exchange(0, std::memory_order_relaxed);
+}
+
+// Write a JSON array of the first size values.
+static void writeArray(std::ostream& out, const uint64_t* values, int size) {
+    out << "[";
+    for (int i = 0; i < size; ++i)
+        out << (i ? "," : "") << values[i];
+    out << "]";
+}
+
+void traceFlush() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceFile.empty()) return;
+    std::ofstream out(traceFile, std::ios::app);
+    if (!out) return;
+
+    // Take the events written since the previous flush. If a ring buffer wrapped around, its oldest events are lost.
+    std::vector<uint64_t> heads, begins;
+    for (ThreadTrace* t : threadTraces) {
+        uint64_t head = t->head.load(std::memory_order_acquire);
+        heads.push_back(head);
+        begins.push_back(std::max(t->tail, head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0));
+    }
+
+    // The iteration events give the duration in microseconds and completion of each iteration, by depth.
+    std::map<int, std::pair<uint64_t, bool>> timings;
+    for (size_t n = 0; n < threadTraces.size(); ++n) {
+        for (uint64_t i = begins[n]; i < heads[n]; ++i) {
+            uint64_t e = threadTraces[n]->events[i % TRACE_RING_SIZE].load(std::memory_order_relaxed);
+            if ((e >> 56) == TRACE_EVENT_ITERATION)
+                timings[(e >> 48) & 0xFF] = std::make_pair(e & 0xFFFFFFFF, ((e >> 32) & 0xFFFF) != 0);
+        }
+    }
+
+    uint64_t cutoffIndex[TRACE_MAX_MOVE_INDEX + 1] = {};
+    for (ThreadTrace* t : threadTraces)
+        for (int i = 0; i <= TRACE_MAX_MOVE_INDEX; ++i)
+            cutoffIndex[i] += takeCounter(t->cutoffIndex[i]);
+    out << "{\"search\":" << traceSearches++ << ",\"cutoffIndex\":";
+    writeArray(out, cutoffIndex, TRACE_MAX_MOVE_INDEX + 1);
+
+    // One entry per iteration, with its counts by ply. Trailing plies that were never reached are left out.
+    // The effective branching factor of an iteration is its number of nodes divided by that of the previous iteration.
+    out << ",\"iterations\":[";
+    bool first = true;
+    uint64_t previousNodes = 0;
+    for (int d = 0; d <= TRACE_MAX_DEPTH; ++d) {
+        uint64_t nodes[TRACE_MAX_PLY + 1] = {}, moves[TRACE_MAX_PLY + 1] = {};
+        uint64_t cutoffs[TRACE_MAX_PLY + 1] = {}, ttCutoffs[TRACE_MAX_PLY + 1] = {};
+        uint64_t totalNodes = 0;
+        int plies = 0;
+        for (int i = 0; i <= TRACE_MAX_PLY; ++i) {
+            for (ThreadTrace* t : threadTraces) {
+                nodes[i] += takeCounter(t->nodes[d][i]);
+                moves[i] += takeCounter(t->moves[d][i]);
+                cutoffs[i] += takeCounter(t->cutoffs[d][i]);
+                ttCutoffs[i] += takeCounter(t->ttCutoffs[d][i]);
+            }
+            totalNodes += nodes[i];
+            if (nodes[i] > 0) plies = i + 1;
+        }
+        auto timing = timings.find(d);
+        if (totalNodes == 0 && timing == timings.end()) {
+            previousNodes = 0;
+            continue;
+        }
+
+        out << (first ? "" : ",") << "{\"depth\":" << d;
+        if (timing != timings.end())
+            out << ",\"us\":" << timing->second.first << ",\"completed\":" << (timing->second.second ? "true" : "false");
+        out << ",\"nodes\":" << totalNodes << ",\"branching\":";
+        if (previousNodes > 0) out << static_cast<double>(totalNodes) / previousNodes;
+        else out << "null";
+        out << ",\"plies\":{\"nodes\":";
+        writeArray(out, nodes, plies);
+        out << ",\"moves\":";
+        writeArray(out, moves, plies);
+        out << ",\"cutoffs\":";
+        writeArray(out, cutoffs, plies);
+        out << ",\"ttCutoffs\":";
+        writeArray(out, ttCutoffs, plies);
+        out << "}}";
+        first = false;
+        previousNodes = totalNodes;
+    }
+
+    // The most recent cutoff events of each thread, oldest first, as [ply, moveIndex].
+    out << "],\"threads\":[";
+    for (size_t n = 0; n < threadTraces.size(); ++n) {
+        ThreadTrace* t = threadTraces[n];
+        out << (n ? "," : "") << "{\"dropped\":" << begins[n] - t->tail << ",\"cutoffs\":[";
+        first = true;
+        for (uint64_t i = begins[n]; i < heads[n]; ++i) {
+            uint64_t e = t->events[i % TRACE_RING_SIZE].load(std::memory_order_relaxed);
+            if ((e >> 56) != TRACE_EVENT_CUTOFF) continue;
+            out << (first ? "" : ",") << "[" << ((e >> 48) & 0xFF) << "," << ((e >> 32) & 0xFFFF) << "]";
+            first = false;
+        }
+        out << "]}";
+        t->tail = heads[n];
+    }
+    out << "]}\n";
+}
+
+#endif
@@ -0,0 +1,56 @@
+// trace.h
+
+#pragma once
+
+#include <string>
+
+// Search tracing, compiled in only when the MINDFIELD_TRACE option is set in CMake,
+// and recording only while enabled at runtime with "setoption name TraceFile value <path>".
+// Every search thread records into its own counters, with relaxed atomic adds, and its own event ring buffer,
+// which only that thread writes, so recording takes no locks. After each search the records of all threads
+// are appended to the trace file as one line of JSON: the counters are taken and reset with an atomic exchange,
+// and the events written since the previous flush are read.
+// In server mode the searches of concurrent sessions are recorded together.
+//
+// Use the TRACE macro to record, e.g. TRACE(traceNode(board.ply)), so that the call and its
+// runtime check are removed entirely when tracing is not compiled in.
+
+#ifdef MINDFIELD_TRACE
+
+#include <atomic>
+
+// Maximum iteration depth and ply recorded, deeper ones are counted as the maximum.
+const int TRACE_MAX_DEPTH = 64;
+const int TRACE_MAX_PLY = 64;
+// Maximum move index recorded for cutoffs, later moves are counted as this index.
+const int TRACE_MAX_MOVE_INDEX = 32;
+// Number of events kept per thread, older events are overwritten.
+const int TRACE_RING_SIZE = 4096;
+
+extern std::atomic<bool> traceEnabled;
+
+#define TRACE(call) do { if (traceEnabled.load(std::memory_order_relaxed)) call; } while (0)
+
+// Set the trace file and enable tracing, or disable it if path is empty.
+void traceSetFile(const std::string& path);
+// Set the depth of the iterative deepening iteration the calling thread searches for.
+// The node, move and cutoff counts of the thread are recorded for this iteration.
+void traceSetIteration(int depth);
+// Record a node visited at ply.
+void traceNode(int ply);
+// Record that the node at ply generated moveCount moves.
+void traceMoves(int ply, int moveCount);
+// Record a beta cutoff at ply by the move at moveIndex in the move list.
+void traceCutoff(int ply, int moveIndex);
+// Record a node at ply decided by the transposition table without being searched.
+void traceTTCutoff(int ply);
+// Record the end of an iteration to depth, which took elapsedUs microseconds, and whether it completed.
+void traceIteration(int depth, long long elapsedUs, bool completed);
+// Append the records of all threads since the previous flush to the trace file.
+void traceFlush();
+
+#else
+
+#define TRACE(call) do {} while (0)
+
+#endif
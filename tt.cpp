@@ -0,0 +1,80 @@
+// tt.cpp
+
+// This file implements the TranspositionTable class, defined in tt.h.
+// The table is a power of two array of single entry slots indexed by the low bits of the key.
+// A new result replaces the stored one unless the stored one is for the same position at a greater depth.
+
+#include "tt.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+TranspositionTable::TranspositionTable(size_t mb) {
+    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
+    maximizingHash = rng();
+    resize(mb);
+}
+
+bool TranspositionTable::resize(size_t mb) {
+    size_t count = 1;
+    while (count * 2 * sizeof(TTEntry) <= mb * 1024 * 1024)
+        count *= 2;
+    // Allocate the new table before releasing the current one, so that a failure keeps the current table.
+    // The memory is cleared by LargeMemory, and zero is a valid empty TTEntry.
+    LargeMemory table;
+    if (!table.allocate(count * sizeof(TTEntry))) return false;
+    memory.swap(table);
+    entries = static_cast<TTEntry*>(memory.data());
+    mask = count - 1;
+    return true;
+}
+
+void TranspositionTable::clear() {
+    memory.clear();
+}
+
+uint64_t TranspositionTable::key(const BoardData& board, bool maximizing) const {
+    uint64_t h = zobrist.computeHash(board);
+    return maximizing ? h ^ maximizingHash : h;
+}
+
+bool TranspositionTable::probe(uint64_t key, int depth, int& alpha, int& beta, int& score) const {
+    if (!entries) return false;
+    const TTEntry& entry = entries[key & mask];
+    uint64_t data = entry.data.load(std::memory_order_relaxed);
+    if ((entry.keyXorData.load(std::memory_order_relaxed) ^ data) != key) return false;
+
+    TTBound bound = static_cast<TTBound>((data >> 40) & 0xFF);
+    if (bound == 0 || static_cast<int>((data >> 32) & 0xFF) < depth) return false;
+    int stored = static_cast<int32_t>(data & 0xFFFFFFFF);
+
+    if (bound == TT_EXACT) {
+        score = stored;
+        return true;
+    }
+    if (bound == TT_LOWER_BOUND) alpha = std::max(alpha, stored);
+    else beta = std::min(beta, stored);
+    if (alpha >= beta) {
+        score = stored;
+        return true;
+    }
+    return false;
+}
+
+void TranspositionTable::store(uint64_t key, int depth, int score, TTBound bound) {
+    if (!entries) return;
+    TTEntry& entry = entries[key & mask];
+    uint64_t old = entry.data.load(std::memory_order_relaxed);
+    bool sameKey = (entry.keyXorData.load(std::memory_order_relaxed) ^ old) == key;
+    if (sameKey && static_cast<int>((old >> 32) & 0xFF) > depth) return;
+
+    uint64_t data = static_cast<uint32_t>(score)
+                  | static_cast<uint64_t>(depth & 0xFF) << 32
+                  | static_cast<uint64_t>(bound) << 40;
+    entry.keyXorData.store(key ^ data, std::memory_order_relaxed);
+    entry.data.store(data, std::memory_order_relaxed);
+}
+
+std::string TranspositionTable::describe() const {
+    return std::to_string(memory.size() / (1024 * 1024)) + " MB on " + memory.pageSizeName() + ", " + memory.placementName();
+}
@@ -0,0 +1,70 @@
+// tt.h
+
+#pragma once
+
+#include "engine.h"
+#include "largememory.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Default and maximum size of the transposition table in MB, as reported by the Hash option.
+const int DEFAULT_HASH_MB = 16;
+const int MAX_HASH_MB = 65536;
+
+// Bound types of a transposition table score.
+// EXACT means the score is the minimax value, LOWER_BOUND means the real value is at least the score
+// (the search failed high) and UPPER_BOUND means the real value is at most the score (failed low).
+enum TTBound : uint8_t {
+    TT_EXACT = 1,
+    TT_LOWER_BOUND = 2,
+    TT_UPPER_BOUND = 3
+};
+
+// The TTEntry structure is one slot of the transposition table.
+// It is read and written by several search threads without locks, so the key is stored
+// xor-ed with the data: an entry torn by two concurrent writes fails the key check.
+struct TTEntry {
+    std::atomic<uint64_t> keyXorData;
+    std::atomic<uint64_t> data; // Bits 0-31 score, bits 32-39 depth, bits 40-47 bound.
+};
+
+// TranspositionTable class to cache search results by position, shared by all search threads.
+// Its memory is allocated through LargeMemory, on huge pages if possible.
+class TranspositionTable {
+public:
+    // Allocate a table of the given size in MB, so that a size known up front is allocated and cleared only once.
+    explicit TranspositionTable(size_t mb = DEFAULT_HASH_MB);
+
+    // Resize the table to the given size in MB, rounded down to a power of two number of entries.
+    // Must not be called while a search is using the table.
+    // Returns false if the memory could not be allocated, in which case the current table is kept.
+    bool resize(size_t mb);
+    // Clear all entries. Must not be called while a search is using the table.
+    void clear();
+    // Returns true if the table has memory, false if its allocation failed.
+    bool allocated() const { return entries != nullptr; }
+
+    // Returns the key of a position, including whether it is searched as a maximizing node.
+    uint64_t key(const BoardData& board, bool maximizing) const;
+    // Look up the position with the given key, searched to at least depth.
+    // Returns true with the score if the entry decides the node within the alpha-beta window,
+    // otherwise narrows alpha and beta with the stored bound and returns false.
+    bool probe(uint64_t key, int depth, int& alpha, int& beta, int& score) const;
+    // Store the score of the position with the given key, searched to depth.
+    void store(uint64_t key, int depth, int score, TTBound bound);
+
+    // Returns a description of the size and page size of the table, e.g. "16 MB on 2 MB pages, first touch from 8 pinned CPUs".
+    std::string describe() const;
+
+private:
+    // The Zobrist keys used to hash the positions.
+    Zobrist zobrist;
+    // Key xor-ed in for maximizing nodes, since the search scores are from white's point of view.
+    uint64_t maximizingHash;
+    // The memory holding the entries.
+    LargeMemory memory;
+    TTEntry* entries = nullptr;
+    // Number of entries minus one, used to map a key to an entry.
+    size_t mask = 0;
+};
@@ -1,70 +1,256 @@
 // uci.cpp
 
 #include "uci.h"
-#include "engine.h"
-#include "search.h"
-#include "threadpool.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
-#include <thread>
 #include <atomic>
 #include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
-std::atomic<bool> stopSearch(false);
-std::thread searchThread;
+// Mutex to protect stdout, since the search threads of all sessions write to it.
+static std::mutex outputMutex;
 
-int timeLimitMs = 1000;  // default 1 second per move
+// Returns the number of worker threads for the shared thread pool.
+static size_t poolSize() {
+    size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+UciSession::UciSession(ThreadPool& pool, TranspositionTable& tt, bool sharedTable, int id, const std::string& prefix)
+    : pool(pool), tt(tt), sharedTable(sharedTable), id(id), prefix(prefix), board(getInitialBoard()), timeLimitMs(1000) {
+    searchControl.tt = &tt;
+}
+
+UciSession::~UciSession() {
+    if (commandThread.joinable()) {
+        if (!closed()) post("quit");
+        commandThread.join();
+    }
+    stopRunningSearch();
+}
+
+void UciSession::post(const std::string& line) {
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        if (!commandThread.joinable())
+            commandThread = std::thread([this]() { runCommands(); });
+        commands.push(line);
+    }
+    commandReady.notify_one();
+}
+
+void UciSession::runCommands() {
+    while (true) {
+        std::string line;
+        {
+            std::unique_lock<std::mutex> lock(commandMutex);
+            commandReady.wait(lock, [this] { return !commands.empty(); });
+            line = std::move(commands.front());
+            commands.pop();
+        }
+        if (!handleCommand(line)) break;
+    }
+    stopRunningSearch();
+    isClosed = true;
+}
+
+void UciSession::send(const std::string& text) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::cout << prefix << text << "\n";
+    std::cout.flush();
+}
+
+void UciSession::stopRunningSearch() {
+    searchControl.stop = true;
+    if (searchThread.joinable()) searchThread.join();
+}
+
+bool UciSession::handleCommand(const std::string& line) {
+    std::istringstream iss(line);
+    std::string token;
+    iss >> token;
+
+    if (token == "uci") {
+        send("id name ModularChessEngine");
+        send("id author You");
+        send("option name Hash type spin default " + std::to_string(DEFAULT_HASH_MB) + " min 1 max " + std::to_string(MAX_HASH_MB));
+        send("option name Ponder type check default false");
+#ifdef MINDFIELD_TRACE
+        send("option name TraceFile type string default <empty>");
+#endif
+        send("uciok");
+    } else if (token == "isready") {
+        send("readyok");
+    } else if (token == "setoption") {
+        // The format is "setoption name Hash value 256", other options are accepted and ignored.
+        // The name runs up to "value" and the value is the rest of the line, so both may contain spaces.
+        std::string name, value;
+        iss >> token; // "name"
+        while (iss >> token && token != "value")
+            name += (name.empty() ? "" : " ") + token;
+        std::getline(iss >> std::ws, value);
+#ifdef MINDFIELD_TRACE
+        if (name == "TraceFile")
+            traceSetFile(value == "<empty>" ? "" : value);
+#endif
+        if (name == "Hash") {
+            if (sharedTable) {
+                send("info string Hash is shared by all sessions, set it with --hash");
+            } else {
+                int mb = std::max(1, std::min(MAX_HASH_MB, std::atoi(value.c_str())));
+                // The table is allocated and cleared here, so the next go is not delayed by it.
+                stopRunningSearch();
+                if (tt.resize(mb))
+                    send("info string Hash " + tt.describe());
+                else
+                    send("info string Hash allocation of " + std::to_string(mb) + " MB failed, keeping " + tt.describe());
+            }
+        }
+    } else if (token == "ucinewgame") {
+        // Results of the previous game are of no use, but a shared table may be in use by other sessions.
+        if (!sharedTable) {
+            stopRunningSearch();
+            tt.clear();
+        }
+    } else if (token == "position") {
+        parsePosition(line, board);
+    } else if (token == "go") {
+        stopRunningSearch();
+        searchControl.stop = false;
+        timeLimitMs = 1000; // reset default
+
+        int depth = MAX_SEARCH_DEPTH;
+        bool ponder = false;
+        bool infinite = false;
+        bool timed = false; // Set if movetime, wtime or btime is given
+        bool depthLimited = false; // Set if depth or mate is given
+        std::string sub;
+        while (iss >> sub) {
+            if (sub == "movetime") {
+                iss >> timeLimitMs;
+                timed = true;
+            } else if (sub == "wtime" || sub == "btime") {
+                int timeRemaining;
+                iss >> timeRemaining;
+                // Only the clock of the side to move is relevant.
+                if ((sub == "wtime") == board.whiteToMove) {
+                    timeLimitMs = timeRemaining / 30; // rough allocation: 1/30th of time
+                    timed = true;
+                }
+            } else if (sub == "depth") {
+                iss >> depth;
+                depthLimited = true;
+            } else if (sub == "mate") {
+                // A mate in n moves is found within 2n - 1 plies.
+                int moves;
+                iss >> moves;
+                depth = 2 * moves - 1;
+                depthLimited = true;
+            } else if (sub == "ponder") {
+                ponder = true;
+            } else if (sub == "infinite") {
+                infinite = true;
+            }
+        }
+
+        // A ponder search runs without a deadline until ponderhit or stop is received.
+        // The time limit computed above is kept in timeLimitMs to be applied on ponderhit.
+        searchControl.setTimeLimit(timeLimitMs);
+        searchControl.pondering = ponder;
+        searchControl.infinite = infinite;
+        // With a depth limit and no clock the search runs to that depth, however long it takes.
+        searchControl.untimed = depthLimited && !timed;
+
+        searchThread = std::thread([this, depth, board = board]() {
+            SearchResult result = findBestMoveParallel(board, depth, searchControl, pool, id);
+            TRACE(traceFlush());
+
+            // The best move must not be reported while pondering or analysing.
+            while (searchControl.mustWait())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            std::string bestmove = "bestmove " + moveToUci(result.bestMove);
+            if (result.ponderMove.from != result.ponderMove.to)
+                bestmove += " ponder " + moveToUci(result.ponderMove);
+            send(bestmove);
+        });
+    } else if (token == "ponderhit") {
+        // The opponent played the expected move: the ongoing search continues as a timed search.
+        // Set the deadline before clearing the flag, so the search cannot see an old deadline.
+        // A ponderhit without a ponder search running is ignored, so it cannot extend a timed search.
+        if (searchControl.pondering.load()) {
+            searchControl.setTimeLimit(timeLimitMs);
+            searchControl.pondering = false;
+        }
+    } else if (token == "stop") {
+        stopRunningSearch();
+    } else if (token == "quit") {
+        return false;
+    }
+    return true;
+}
 
 void runUciLoop() {
-    BoardData board = getInitialBoard();
+    ThreadPool pool(poolSize());
+    TranspositionTable tt;
+    UciSession session(pool, tt, false, 0, "");
+    std::string line;
+
+    while (std::getline(std::cin, line)) {
+        if (!session.handleCommand(line)) break;
+    }
+}
+
+void runServerLoop(int hashMb) {
+    // One thread pool and one transposition table serve all sessions, so the number of search threads
+    // and the memory used do not grow with them. They are declared before the sessions so they outlive their search threads.
+    ThreadPool pool(poolSize());
+    // Every line on stdout belongs to a session, so messages about the whole server go to stderr.
+    int mb = std::max(1, std::min(MAX_HASH_MB, hashMb));
+    TranspositionTable tt(mb);
+    if (tt.allocated())
+        std::cerr << "info string Hash " << tt.describe() << std::endl;
+    else
+        std::cerr << "info string Hash allocation of " << mb << " MB failed, sessions run without a transposition table" << std::endl;
+    std::map<std::string, std::unique_ptr<UciSession>> sessions;
+    // Sessions that received quit, kept until their command thread has stopped their search.
+    std::vector<std::unique_ptr<UciSession>> closing;
+    int nextId = 0;
     std::string line;
 
     while (std::getline(std::cin, line)) {
         std::istringstream iss(line);
-        std::string token;
-        iss >> token;
-
-        if (token == "uci") {
-            std::cout << "id name ModularChessEngine\n";
-            std::cout << "id author You\n";
-            std::cout << "uciok\n";
-        } else if (token == "isready") {
-            std::cout << "readyok\n";
-        } else if (token == "position") {
-            parsePosition(line, board);
-        } else if (token == "go") {
-            stopSearch = false;
-            timeLimitMs = 1000; // reset default
-
-            std::string sub;
-            while (iss >> sub) {
-                if (sub == "movetime") {
-                    iss >> timeLimitMs;
-                } else if (sub == "wtime" || sub == "btime") {
-                    int timeRemaining;
-                    iss >> timeRemaining;
-                    timeLimitMs = timeRemaining / 30; // rough allocation: 1/30th of time
-                }
-            }
+        std::string sessionId;
+        if (!(iss >> sessionId)) continue;
+        std::string command;
+        std::getline(iss >> std::ws, command);
 
-            if (searchThread.joinable()) searchThread.join();
-            searchThread = std::thread([board]() {
-                auto start = std::chrono::steady_clock::now();
-                Move bestMove = findBestMoveParallel(board, 4, timeLimitMs);
-                auto end = std::chrono::steady_clock::now();
+        // A session is opened by its first command.
+        auto it = sessions.find(sessionId);
+        if (it == sessions.end())
+            it = sessions.emplace(sessionId, std::make_unique<UciSession>(pool, tt, true, nextId++, sessionId + " ")).first;
 
-                if (!stopSearch.load()) {
-                    std::cout << "bestmove " << moveToUci(bestMove) << "\n";
-                    std::cout.flush();
-                }
-            });
-        } else if (token == "stop") {
-            stopSearch = true;
-            if (searchThread.joinable()) searchThread.join();
-        } else if (token == "quit") {
-            stopSearch = true;
-            if (searchThread.joinable()) searchThread.join();
-            break;
+        // Commands are handled on the session's own thread, so this loop never waits for a search.
+        it->second->post(command);
+
+        // On quit the session stops its search and is closed. A later command with the same id opens a new session.
+        std::istringstream commandStream(command);
+        std::string token;
+        if (commandStream >> token && token == "quit") {
+            closing.push_back(std::move(it->second));
+            sessions.erase(it);
         }
+        closing.erase(std::remove_if(closing.begin(), closing.end(),
+                                     [](const std::unique_ptr<UciSession>& s) { return s->closed(); }),
+                      closing.end());
     }
+    // At end of input, close all sessions before the thread pool is destroyed.
+    sessions.clear();
+    closing.clear();
 }
@@ -2,4 +2,74 @@
 
 #pragma once
 
+#include "engine.h"
+#include "search.h"
+#include "threadpool.h"
+#include "tt.h"
+#include <string>
+#include <thread>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// UciSession class to hold the state of one UCI conversation with a GUI.
+// It owns the current position and the running search, and writes its output
+// prefixed with its session prefix, so many sessions can share one process.
+// All sessions share the same ThreadPool, which schedules their tasks fairly.
+// If the TranspositionTable is shared with other sessions, this session may not resize or clear it.
+class UciSession {
+public:
+    UciSession(ThreadPool& pool, TranspositionTable& tt, bool sharedTable, int id, const std::string& prefix);
+    ~UciSession();
+
+    // Handle one UCI command line.
+    // Returns false if the command was quit and the session should be closed.
+    bool handleCommand(const std::string& line);
+    // Queue one UCI command line to be handled on the session's own command thread.
+    // Used in server mode, so that a session waiting for its search to stop does not hold up the others.
+    void post(const std::string& line);
+    // Returns true once a posted quit has been handled and the search has stopped.
+    bool closed() const { return isClosed.load(); }
+
+private:
+    // Write one line of output, prefixed with the session prefix.
+    void send(const std::string& text);
+    // Stop the running search, if any, and wait for it to report its best move.
+    void stopRunningSearch();
+    // Handle the posted commands in order until quit.
+    void runCommands();
+
+    // The thread pool used to run the search tasks, shared with the other sessions.
+    ThreadPool& pool;
+    // The transposition table used by the search, and whether it is shared with the other sessions.
+    TranspositionTable& tt;
+    bool sharedTable;
+    // The session id, used by the thread pool to schedule tasks fairly between sessions.
+    int id;
+    // The prefix written in front of every output line, empty in single session mode.
+    std::string prefix;
+    // The current position, set by the position command.
+    BoardData board;
+    // The shared state used to stop the running search or turn a ponder search into a timed search.
+    SearchControl searchControl;
+    // The thread that runs the search and reports the best move.
+    std::thread searchThread;
+    // The time allocated for the current move, applied on ponderhit when pondering.
+    int timeLimitMs;
+    // The thread handling the posted commands, started by the first post.
+    std::thread commandThread;
+    // Posted commands waiting to be handled, protected by commandMutex.
+    std::queue<std::string> commands;
+    std::mutex commandMutex;
+    std::condition_variable commandReady;
+    // Set once the command thread has handled quit.
+    std::atomic<bool> isClosed{false};
+};
+
+// Run a single UCI session on stdin and stdout.
 void runUciLoop();
+// Run many UCI sessions on stdin and stdout. Every input line starts with a session id
+// followed by a UCI command, and every output line starts with the session id it belongs to.
+// All sessions share one transposition table of hashMb MB.
+void runServerLoop(int hashMb);